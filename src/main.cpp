@@ -12,16 +12,38 @@ int main() {
     float focal_length = 1.0f;
     int anti_aliasing_samples = 100;
 
+    // Out-of-core rendering parameters (streams tiles to disk instead of holding the full image)
+    bool tiled_output = false;
+    int tile_size = 64;
+
+    // Breadth-first tile tracing with sorted secondary rays (A/B switch)
+    bool sort_secondary_rays = false;
+
+    // Path guiding parameters (low resolution training passes before the final render)
+    // Off by default: the per bounce overhead outweighs the variance it removes in this scene
+    bool path_guiding = false;
+    int guide_training_passes = 4;
+    int guide_training_samples = 4;
+
+    // Sun shadow map parameters (replaces shadow rays with a filtered lookup, static scenes only)
+    bool sun_shadow_cache = false;
+    int shadow_map_resolution = 2048;
+    float shadow_map_bias = 1e-2f;
+    int shadow_map_filter_radius = 1;
+
     vec3 cam_position(0, 0, 0);
     DCM cam_orientation(vec3(1, 0, 0), vec3(0, 1, 0), vec3(0, 0, 1)); // Identity orientation (looking along +X)
 
+    // Scene objects are placed in one arena, it must outlive the scene
+    scene_arena arena;
+
     // Sphere parameters
     vec3 sphere_1_center(5, 1, 0);
     vec3 sphere_2_center(6, -1, -1);
     vec3 sphere_3_center(8, -1, 1);
-    auto sphere_1_material = std::make_shared<lambertian>(col3(1.0f, 0.0f, 0.0f));
-    auto sphere_2_material = std::make_shared<lambertian>(col3(0.0f, 0.0f, 1.0f));
-    auto sphere_3_material = std::make_shared<metal>(col3(0.8f, 0.8f, 0.8f));
+    auto sphere_1_material = arena.make<lambertian>(col3(1.0f, 0.0f, 0.0f));
+    auto sphere_2_material = arena.make<lambertian>(col3(0.0f, 0.0f, 1.0f));
+    auto sphere_3_material = arena.make<metal>(col3(0.8f, 0.8f, 0.8f));
     float sphere_radius = 1.0f;
 
     // Point light parameters
@@ -33,26 +55,59 @@ int main() {
 
     // Create camera, sphere, image and point light objects
     pinhole_cam cam(cam_position, cam_orientation, fov, aspect_ratio, focal_length);
-    sphere sph_1(sphere_1_center, sphere_radius, sphere_1_material);
-    sphere sph_2(sphere_2_center, sphere_radius, sphere_2_material);
-    sphere sph_3(sphere_3_center, sphere_radius, sphere_3_material);
-    image img(image_width, image_height);
+    image img(tiled_output ? 0 : image_width, tiled_output ? 0 : image_height);
     directional_light dir_light(light_direction, light_color, radiance);
 
     // Create a hittable list and add the spheres to it
     hittable_list scene;
-    scene.add(std::make_shared<sphere>(sph_1));
-    scene.add(std::make_shared<sphere>(sph_2));
-    scene.add(std::make_shared<sphere>(sph_3));
+    scene.add(arena.make<sphere>(sphere_1_center, sphere_radius, sphere_1_material));
+    scene.add(arena.make<sphere>(sphere_2_center, sphere_radius, sphere_2_material));
+    scene.add(arena.make<sphere>(sphere_3_center, sphere_radius, sphere_3_material));
 
     // Start timing the rendering process
     auto start_time = std::chrono::high_resolution_clock::now();
 
-    // Render the scene
-    render(cam, scene, img, dir_light, anti_aliasing_samples);
+    // Build the sun occlusion cache once, before any pass traces shadows
+    std::unique_ptr<sun_shadow_map> shadow_map;
+    if (sun_shadow_cache) {
+        aabb shadow_bounds;
+        scene.bounding_box(shadow_bounds);
+        shadow_map = std::make_unique<sun_shadow_map>(dir_light, shadow_bounds, shadow_map_resolution, shadow_map_bias, shadow_map_filter_radius);
+        shadow_map->build(scene);
+        dir_light.shadow_map = shadow_map.get();
+    }
+
+    if (tiled_output) {
+        // Render the scene tile by tile, tiles are written as they complete
+        tiled_image tiled_img(image_width, image_height, tile_size, "recursive_ray_tracing.ppm");
+        render_tiled(cam, scene, tiled_img, dir_light, anti_aliasing_samples);
+        tiled_img.close();
+    } else if (sort_secondary_rays || path_guiding) {
+        // Render the scene tile by tile
+        render_options opts;
+        opts.aa_N = anti_aliasing_samples;
+        opts.sort_rays = sort_secondary_rays;
+
+        // Train the guide over the visible part of the scene, the floor sphere would stretch the grid
+        std::unique_ptr<path_guide> guide;
+        if (path_guiding) {
+            aabb guide_bounds = visible_bounds(cam, scene, image_width / 4, image_height / 4, 0.5f);
+            guide = std::make_unique<path_guide>(guide_bounds);
+            train_path_guide(*guide, cam, scene, dir_light, image_width / 4, image_height / 4, guide_training_passes, guide_training_samples);
+            opts.guide = guide.get();
+        }
+
+        render_async(cam, scene, img, dir_light, opts)->wait();
+
+        // Write the rendered image to file
+        img.write_ppm("recursive_ray_tracing.ppm");
+    } else {
+        // Render the scene
+        render(cam, scene, img, dir_light, anti_aliasing_samples);
 
-    // Write the rendered image to file
-    img.write_ppm("recursive_ray_tracing.ppm"); 
+        // Write the rendered image to file
+        img.write_ppm("recursive_ray_tracing.ppm"); 
+    }
     
     // End timing and calculate duration
     auto end_time = std::chrono::high_resolution_clock::now();
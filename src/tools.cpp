@@ -6,6 +6,18 @@
 #include <thread>
 #include <random>
 #include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+// render thread count function definition
+static unsigned int render_thread_count(unsigned int limit) {
+    unsigned int num_threads = std::thread::hardware_concurrency();
+    if (num_threads == 0) num_threads = 4; // Fallback to 4 threads if hardware_concurrency cannot determine
+    return std::max(1u, std::min(num_threads, limit));
+}
 
 // vec3 class member function definitions
 vec3::vec3(float x, float y, float z) : x(x), y(y), z(z) {}
@@ -142,6 +154,69 @@ bool image::write_ppm(const std::string& filepath) const {
     return true;
 }
 
+// tiled image class member function definitions
+tiled_image::tiled_image(int width, int height, int tile_size, const std::string& filepath) :
+    width(width),
+    height(height),
+    tile_size(std::max(1, tile_size)),
+    out(filepath, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc),
+    data_offset(0) {
+
+        if (!out) return;
+
+        out << "P6\n" << width << " " << height << "\n255\n";
+        data_offset = out.tellp();
+
+        // Reserve the full file so tiles can be written in any order
+        std::streamoff data_size = static_cast<std::streamoff>(width) * height * 3;
+        if (data_size > 0) {
+            out.seekp(data_offset + data_size - 1);
+            out.put(0);
+        }
+    };
+
+int tiled_image::tiles_x() const {
+    return (width + tile_size - 1) / tile_size;
+}
+
+int tiled_image::tiles_y() const {
+    return (height + tile_size - 1) / tile_size;
+}
+
+int tiled_image::num_tiles() const {
+    return tiles_x() * tiles_y();
+}
+
+tile tiled_image::get_tile(int id) const {
+    int tx = id % tiles_x();
+    int ty = id / tiles_x();
+    int x0 = tx * tile_size;
+    int y0 = ty * tile_size;
+    return tile{x0, y0, std::min(x0 + tile_size, width), std::min(y0 + tile_size, height)};
+}
+
+bool tiled_image::write_tile(const tile& t, const std::uint8_t* rgb, int stride) {
+    std::lock_guard<std::mutex> lock(out_mutex);
+    if (!out) return false;
+
+    for (int y = t.y0; y < t.y1; ++y) {
+        std::streamoff offset = data_offset + (static_cast<std::streamoff>(y) * width + t.x0) * 3;
+        out.seekp(offset);
+        out.write(reinterpret_cast<const char*>(rgb + static_cast<size_t>(y - t.y0) * stride), (std::streamsize)t.width() * 3);
+    }
+    return static_cast<bool>(out);
+}
+
+bool tiled_image::close() {
+    std::lock_guard<std::mutex> lock(out_mutex);
+    if (!out.is_open()) return false;
+
+    out.flush();
+    bool ok = static_cast<bool>(out);
+    out.close();
+    return ok;
+}
+
 // gradient image generation function definition
 void gradient_image(int width, int height, const std::string& filepath) {
     image img(width, height);
@@ -174,37 +249,166 @@ void hit_record::set_face_normal(const ray& cast_ray, const vec3& out_normal) {
     normal = front_face ? out_normal : (out_normal * -1);
 };
 
+// scattered ray construction
+static inline ray offset_ray(const hit_record& rec, const vec3& direction) {
+    // Small offset to avoid self-intersection, on the side the ray leaves from
+    float epsilon = 1e-3f;
+    vec3 offset = rec.normal * (direction.dot(rec.normal) > 0.0f ? epsilon : -epsilon);
+    return ray(rec.point + offset, direction);
+}
+
+// material class member function definitions
+bool material::scatter(const ray& in_ray, const hit_record& rec, col3& attenuation, ray& scattered) const {
+    bsdf_sample s;
+    if (!sample(in_ray, rec, s)) return false;
+
+    scattered = offset_ray(rec, s.direction);
+    attenuation = s.weight;
+    return true;
+};
+
 // lambertian class member function definition
 lambertian::lambertian(const col3& albedo) : albedo(albedo) {};
 
-bool lambertian::scatter(const ray& in_ray, const hit_record& rec, col3& attenuation, ray& scattered) const {
-    vec3 scatter_direction = rec.normal + rand_vec();
+bool lambertian::sample(const ray& in_ray, const hit_record& rec, bsdf_sample& s) const {
+    // Cosine weighted sampling, f * cos / pdf reduces to the albedo
+    s.direction = rand_cosine_dir(rec.normal);
+    s.pdf = std::max(0.0f, s.direction.dot(rec.normal)) / static_cast<float>(M_PI);
+    s.weight = albedo;
+    s.specular = false;
+    return true;
+};
 
-    if (scatter_direction.norm() < 1e-8f) {
-        scatter_direction = rec.normal;
-    }
+col3 lambertian::eval(const vec3& in_dir, const vec3& out_dir, const hit_record& rec) const {
+    if (out_dir.dot(rec.normal) <= 0.0f) return col3();
+    return albedo / static_cast<float>(M_PI);
+};
 
-    float epsilon = 1e-3f; // Small offset to avoid self-intersection
-    scattered = ray(rec.point + rec.normal * epsilon, scatter_direction);
-    attenuation = albedo;
-    return true;
+float lambertian::pdf(const vec3& in_dir, const vec3& out_dir, const hit_record& rec) const {
+    return std::max(0.0f, out_dir.dot(rec.normal)) / static_cast<float>(M_PI);
 };
 
 // metal class member function definition
 metal::metal(const col3& albedo) : albedo(albedo) {};
 
-bool metal::scatter(const ray& in_ray, const hit_record& rec, col3& attenuation, ray& scattered) const {
-    vec3 reflected = in_ray.direction.reflect(rec.normal);
+bool metal::sample(const ray& in_ray, const hit_record& rec, bsdf_sample& s) const {
+    s.direction = in_ray.direction.reflect(rec.normal).normalized();
+    s.pdf = 0.0f;
+    s.weight = albedo;
+    s.specular = true;
 
-    float epsilon = 1e-3f; // Small offset to avoid self-intersection
-    scattered = ray(rec.point + rec.normal * epsilon, reflected);
-    attenuation = albedo;
+    return (s.direction.dot(rec.normal) > 0.0f);
+};
+
+// glossy class member function definitions
+glossy::glossy(const col3& albedo, float roughness) :
+    albedo(albedo),
+    roughness(roughness),
+    alpha(std::max(1e-3f, roughness * roughness)) {};
+
+// GGX normal distribution and Smith masking terms
+static inline float ggx_d(float ndoth, float alpha) {
+    float a2 = alpha * alpha;
+    float denom = ndoth * ndoth * (a2 - 1.0f) + 1.0f;
+    return a2 / (static_cast<float>(M_PI) * denom * denom);
+}
 
-    return (reflected.dot(rec.normal) > 0.0f);
+static inline float ggx_g1(float ndotx, float alpha) {
+    float a2 = alpha * alpha;
+    return 2.0f * ndotx / (ndotx + std::sqrt(a2 + (1.0f - a2) * ndotx * ndotx));
+}
+
+bool glossy::sample(const ray& in_ray, const hit_record& rec, bsdf_sample& s) const {
+    const vec3 view = -in_ray.direction;
+    const float ndotv = rec.normal.dot(view);
+    if (ndotv <= 0.0f) return false;
+
+    // Sample the half vector from the GGX distribution
+    float xi1 = randf01();
+    float xi2 = randf01();
+    float tan2_theta = alpha * alpha * xi1 / std::max(1e-6f, 1.0f - xi1);
+    float cos_theta = 1.0f / std::sqrt(1.0f + tan2_theta);
+    float sin_theta = std::sqrt(std::max(0.0f, 1.0f - cos_theta * cos_theta));
+    float phi = 2.0f * static_cast<float>(M_PI) * xi2;
+
+    vec3 t, b;
+    orthonormal_basis(rec.normal, t, b);
+    vec3 half = (t * (sin_theta * std::cos(phi)) + b * (sin_theta * std::sin(phi)) + rec.normal * cos_theta).normalized();
+
+    s.direction = in_ray.direction.reflect(half).normalized();
+    const float ndotl = rec.normal.dot(s.direction);
+    const float vdoth = view.dot(half);
+    if (ndotl <= 0.0f || vdoth <= 0.0f) return false;
+
+    // f * cos / pdf = F * G * (v.h) / ((n.v) * (n.h))
+    float ndoth = cos_theta;
+    float g = ggx_g1(ndotv, alpha) * ggx_g1(ndotl, alpha);
+    float w = g * vdoth / (ndotv * ndoth);
+    s.weight = col3(
+        schlick(vdoth, albedo.r) * w,
+        schlick(vdoth, albedo.g) * w,
+        schlick(vdoth, albedo.b) * w);
+    s.pdf = ggx_d(ndoth, alpha) * ndoth / (4.0f * vdoth);
+    s.specular = false;
+    return true;
+};
+
+col3 glossy::eval(const vec3& in_dir, const vec3& out_dir, const hit_record& rec) const {
+    const vec3 view = -in_dir;
+    const float ndotv = rec.normal.dot(view);
+    const float ndotl = rec.normal.dot(out_dir);
+    if (ndotv <= 0.0f || ndotl <= 0.0f) return col3();
+
+    vec3 half = (view + out_dir).normalized();
+    float ndoth = std::max(0.0f, rec.normal.dot(half));
+    float vdoth = std::max(0.0f, view.dot(half));
+
+    float dg = ggx_d(ndoth, alpha) * ggx_g1(ndotv, alpha) * ggx_g1(ndotl, alpha) / (4.0f * ndotv * ndotl);
+    return col3(
+        schlick(vdoth, albedo.r) * dg,
+        schlick(vdoth, albedo.g) * dg,
+        schlick(vdoth, albedo.b) * dg);
+};
+
+float glossy::pdf(const vec3& in_dir, const vec3& out_dir, const hit_record& rec) const {
+    const vec3 view = -in_dir;
+    if (rec.normal.dot(view) <= 0.0f || rec.normal.dot(out_dir) <= 0.0f) return 0.0f;
+
+    vec3 half = (view + out_dir).normalized();
+    float ndoth = std::max(0.0f, rec.normal.dot(half));
+    float vdoth = view.dot(half);
+    if (vdoth <= 0.0f) return 0.0f;
+
+    return ggx_d(ndoth, alpha) * ndoth / (4.0f * vdoth);
+};
+
+// dielectric class member function definitions
+dielectric::dielectric(float ior) : ior(ior) {};
+
+bool dielectric::sample(const ray& in_ray, const hit_record& rec, bsdf_sample& s) const {
+    // The normal always faces the incoming ray, front_face tells which medium it comes from
+    const float eta = rec.front_face ? (1.0f / ior) : ior;
+    const float cos_i = std::min(1.0f, -in_ray.direction.dot(rec.normal));
+    const float sin2_t = eta * eta * (1.0f - cos_i * cos_i);
+
+    const float r0 = ((1.0f - ior) / (1.0f + ior)) * ((1.0f - ior) / (1.0f + ior));
+
+    if (sin2_t > 1.0f || randf01() < schlick(cos_i, r0)) {
+        s.direction = in_ray.direction.reflect(rec.normal).normalized();
+    } else {
+        float cos_t = std::sqrt(1.0f - sin2_t);
+        s.direction = (in_ray.direction * eta + rec.normal * (eta * cos_i - cos_t)).normalized();
+    }
+
+    // Fresnel is accounted for by the lobe selection probability
+    s.weight = col3(1.0f, 1.0f, 1.0f);
+    s.pdf = 0.0f;
+    s.specular = true;
+    return true;
 };
 
 // sphere class member function definitions
-sphere::sphere(const vec3& center, float radius, std::shared_ptr<material> mat) : center(center), radius(radius), mat(mat) {};
+sphere::sphere(const vec3& center, float radius, const material* mat) : center(center), radius(radius), mat(mat) {};
 
 bool sphere::hit(const ray& cast_ray, float t_min, float t_max, hit_record& rec) const {
 
@@ -236,11 +440,27 @@ bool sphere::hit(const ray& cast_ray, float t_min, float t_max, hit_record& rec)
     return true;
 }
 
+bool sphere::bounding_box(aabb& box) const {
+    vec3 r(radius, radius, radius);
+    box = aabb(center - r, center + r);
+    return true;
+}
+
 // hittable list class member function definitions
 void hittable_list::add(std::shared_ptr<hittable> object) {
+        objects.push_back(object.get());
+        owned.push_back(object);
+};
+
+void hittable_list::add(const hittable* object) {
         objects.push_back(object);
 };
 
+const material* hittable_list::keep(std::shared_ptr<material> mat) {
+        materials.push_back(mat);
+        return mat.get();
+};
+
 bool hittable_list::hit(const ray& cast_ray, float t_min, float t_max, hit_record& rec) const {
     hit_record temp_rec;
     bool hit_anything = false;
@@ -257,6 +477,114 @@ bool hittable_list::hit(const ray& cast_ray, float t_min, float t_max, hit_recor
     return hit_anything;
 };  
 
+bool hittable_list::bounding_box(aabb& box) const {
+    box = aabb();
+    for (const auto& object : objects) {
+        aabb object_box;
+        if (!object->bounding_box(object_box)) return false;
+        box.expand(object_box);
+    }
+    return !box.empty();
+};
+
+// axis aligned bounding box class member function definitions
+void aabb::expand(const aabb& box) {
+    lo = vec3(std::min(lo.x, box.lo.x), std::min(lo.y, box.lo.y), std::min(lo.z, box.lo.z));
+    hi = vec3(std::max(hi.x, box.hi.x), std::max(hi.y, box.hi.y), std::max(hi.z, box.hi.z));
+}
+
+// aligned offset function definition
+// Aligns the absolute address, blocks themselves are only 64 byte aligned
+static inline size_t aligned_offset(const std::uint8_t* base, size_t offset, size_t align) {
+    std::uintptr_t address = reinterpret_cast<std::uintptr_t>(base) + offset;
+    std::uintptr_t aligned = (address + align - 1) & ~(static_cast<std::uintptr_t>(align) - 1);
+    return offset + static_cast<size_t>(aligned - address);
+}
+
+// scene arena class member function definitions
+scene_arena::scene_arena(size_t block_size, bool huge_pages) : block_size(block_size), huge_pages(huge_pages) {};
+
+scene_arena::~scene_arena() {
+    // Only objects with non-trivial destructors are visited, memory is released block by block
+    for (auto it = destructors.rbegin(); it != destructors.rend(); ++it) it->destroy(it->obj);
+
+    for (const block& b : blocks) {
+#if defined(__linux__)
+        if (b.mapped) {
+            munmap(b.data, b.size);
+            continue;
+        }
+#endif
+        ::operator delete(b.data, std::align_val_t(64));
+    }
+}
+
+void* scene_arena::allocate(size_t size, size_t align) {
+    size_t start = blocks.empty() ? 0 : aligned_offset(blocks.back().data, offset, align);
+
+    if (blocks.empty() || start + size > blocks.back().size) {
+        block b{nullptr, std::max(block_size, size + align), false};
+
+#if defined(__linux__)
+        if (huge_pages) {
+            // Round to 2 MiB so the kernel can back the block with transparent huge pages
+            constexpr size_t huge_page = size_t(1) << 21;
+            size_t mapped_size = (b.size + huge_page - 1) & ~(huge_page - 1);
+            void* p = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p != MAP_FAILED) {
+                madvise(p, mapped_size, MADV_HUGEPAGE);
+                b = block{static_cast<std::uint8_t*>(p), mapped_size, true};
+            }
+        }
+#endif
+        if (!b.data) b.data = static_cast<std::uint8_t*>(::operator new(b.size, std::align_val_t(64)));
+
+        blocks.push_back(b);
+        start = aligned_offset(b.data, 0, align);   // Blocks hold size + align bytes, so this fits
+    }
+
+    offset = start + size;
+    used += size;
+    return blocks.back().data + start;
+}
+
+// scratch arena class member function definitions
+scratch_arena::~scratch_arena() {
+    for (const auto& b : blocks) ::operator delete(b.first, std::align_val_t(64));
+}
+
+void* scratch_arena::allocate(size_t size, size_t align) {
+    while (current < blocks.size()) {
+        size_t start = aligned_offset(blocks[current].first, offset, align);
+        if (start + size <= blocks[current].second) {
+            offset = start + size;
+            return blocks[current].first + start;
+        }
+        ++current;
+        offset = 0;
+    }
+
+    // Grow geometrically, so a thread settles on a few blocks after its first tiles
+    size_t last = blocks.empty() ? (size_t(1) << 16) : blocks.back().second;
+    size_t size_new = std::max(2 * last, size + align);
+    blocks.emplace_back(static_cast<std::uint8_t*>(::operator new(size_new, std::align_val_t(64))), size_new);
+    current = blocks.size() - 1;
+    size_t start = aligned_offset(blocks.back().first, 0, align);
+    offset = start + size;
+    return blocks.back().first + start;
+}
+
+void scratch_arena::reset() {
+    current = 0;
+    offset = 0;
+}
+
+// thread scratch function definition
+scratch_arena& thread_scratch() {
+    static thread_local scratch_arena scratch;
+    return scratch;
+}
+
 // pinhole camera class member function definitions
 pinhole_cam::pinhole_cam(
     const vec3& position,
@@ -301,6 +629,90 @@ point_light::point_light(const vec3& position, float intensity) : position(posit
 // directional light class member function definitions
 directional_light::directional_light(const vec3& direction, const col3& color, const float& radiance) : direction(direction.normalized()), color(color), radiance(radiance) {};
 
+// sun shadow map class member function definitions
+sun_shadow_map::sun_shadow_map(const directional_light& dir_light, const aabb& bounds, int resolution, float bias, int filter_radius) :
+    bias(bias),
+    filter_radius(std::max(0, filter_radius)),
+    light_dir(dir_light.direction),
+    resolution(std::max(1, resolution)) {
+
+        orthonormal_basis(light_dir, axis_u, axis_v);
+
+        // Fit a square map around the light space projection of the bounds
+        float u_max = -1e30f, v_max = -1e30f;
+        u_min = v_min = d_min = 1e30f;
+        for (int c = 0; c < 8; ++c) {
+            vec3 corner((c & 1) ? bounds.hi.x : bounds.lo.x, (c & 2) ? bounds.hi.y : bounds.lo.y, (c & 4) ? bounds.hi.z : bounds.lo.z);
+            u_min = std::min(u_min, corner.dot(axis_u));
+            v_min = std::min(v_min, corner.dot(axis_v));
+            d_min = std::min(d_min, corner.dot(light_dir));
+            u_max = std::max(u_max, corner.dot(axis_u));
+            v_max = std::max(v_max, corner.dot(axis_v));
+        }
+        texel_size = std::max(1e-6f, std::max(u_max - u_min, v_max - v_min) / static_cast<float>(this->resolution));
+
+        depth.assign(static_cast<size_t>(this->resolution) * this->resolution, 1e30f);
+    };
+
+void sun_shadow_map::build(const hittable_list& scene) {
+
+    unsigned int num_threads = render_thread_count(static_cast<unsigned int>(resolution));
+
+    // One ray per texel center, cast from behind the scene along the light direction
+    std::atomic<int> next_row(0);
+    auto worker = [&]() {
+        hit_record rec;
+        const float start = d_min - 1.0f;
+        for (int j = next_row++; j < resolution; j = next_row++) {
+            for (int i = 0; i < resolution; ++i) {
+                vec3 origin = axis_u * (u_min + (i + 0.5f) * texel_size) + axis_v * (v_min + (j + 0.5f) * texel_size) + light_dir * start;
+                ray light_ray(origin, light_dir);
+                depth[static_cast<size_t>(j) * resolution + i] = scene.hit(light_ray, 0.0f, 1e30f, rec) ? start + rec.t : 1e30f;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads);
+    for (unsigned int t = 0; t < num_threads; ++t) threads.emplace_back(worker);
+    for (auto& th : threads) th.join();
+}
+
+float sun_shadow_map::visibility(const vec3& point, const vec3& normal) const {
+    // Offset along the normal by one texel, the main source of acne on curved surfaces
+    vec3 p = point + normal * texel_size;
+
+    const float pu = (p.dot(axis_u) - u_min) / texel_size - 0.5f;
+    const float pv = (p.dot(axis_v) - v_min) / texel_size - 0.5f;
+    const float pd = p.dot(light_dir);
+
+    const int i0 = static_cast<int>(std::floor(pu + 0.5f));
+    const int j0 = static_cast<int>(std::floor(pv + 0.5f));
+
+    // Slope scaled bias, a surface tilted away from the sun drifts by tan(theta) per texel of
+    // filter footprint. Clamped at grazing angles, where n dot l makes the sun term negligible.
+    const float cos_theta = std::max(1e-3f, -normal.dot(light_dir));
+    const float tan_theta = std::min(10.0f, std::sqrt(std::max(0.0f, 1.0f - cos_theta * cos_theta)) / cos_theta);
+    const float tolerance = bias + texel_size * static_cast<float>(filter_radius + 1) * tan_theta;
+
+    int lit = 0;
+    int taps = 0;
+    for (int dj = -filter_radius; dj <= filter_radius; ++dj) {
+        for (int di = -filter_radius; di <= filter_radius; ++di) {
+            int i = i0 + di;
+            int j = j0 + dj;
+            ++taps;
+
+            // Nothing outside the map can occlude
+            if (i < 0 || i >= resolution || j < 0 || j >= resolution || pd <= depth[static_cast<size_t>(j) * resolution + i] + tolerance) {
+                ++lit;
+            }
+        }
+    }
+
+    return static_cast<float>(lit) / static_cast<float>(taps);
+}
+
 // random function definition
 float randf01() {
     static thread_local std::mt19937 gen(std::random_device{}());
@@ -315,7 +727,39 @@ float clamp01(float x) {
 
 // random vector function definition
 vec3 rand_vec() {
-    return vec3(2.0f * randf01() - 1.0f, 2.0f * randf01() - 1.0f, 2.0f * randf01() - 1.0f).normalized();
+    // Uniform on the unit sphere (normalizing a point from a cube is biased towards the corners)
+    float z = 1.0f - 2.0f * randf01();
+    float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+    float phi = 2.0f * static_cast<float>(M_PI) * randf01();
+    return vec3(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+// cosine weighted hemisphere sampling function definition
+vec3 rand_cosine_dir(const vec3& n) {
+    float r2 = randf01();
+    float r = std::sqrt(r2);
+    float phi = 2.0f * static_cast<float>(M_PI) * randf01();
+
+    vec3 t, b;
+    orthonormal_basis(n, t, b);
+    return t * (r * std::cos(phi)) + b * (r * std::sin(phi)) + n * std::sqrt(std::max(0.0f, 1.0f - r2));
+}
+
+// orthonormal basis function definition
+void orthonormal_basis(const vec3& n, vec3& t, vec3& b) {
+    // Branchless construction for a normalized n (Duff et al. 2017)
+    float sign = std::copysign(1.0f, n.z);
+    float a = -1.0f / (sign + n.z);
+    float c = n.x * n.y * a;
+    t = vec3(1.0f + sign * n.x * n.x * a, sign * c, -sign * n.x);
+    b = vec3(c, sign + n.y * n.y * a, -n.y);
+}
+
+// Schlick Fresnel function definition
+float schlick(float cosine, float f0) {
+    float m = clamp01(1.0f - cosine);
+    float m2 = m * m;
+    return f0 + (1.0f - f0) * m2 * m2 * m;
 }
 
 // Reinhard tone mapping function definition
@@ -346,8 +790,234 @@ bool in_shadow(const vec3& point, const vec3& out_normal, const vec3& light_dir,
     return scene.hit(shadow_ray, epsilon, 1e30f, rec);
 };
 
+// path guide class member function definitions
+path_guide::path_guide(const aabb& bounds, int resolution, int dir_resolution) :
+    bounds(bounds),
+    resolution(std::max(1, resolution)),
+    bins_theta(std::max(1, dir_resolution)),
+    bins_phi(2 * std::max(1, dir_resolution)) {
+
+        num_bins = bins_theta * bins_phi;
+        const size_t size = static_cast<size_t>(this->resolution) * this->resolution * this->resolution * num_bins;
+
+        histogram.reset(new std::atomic<float>[size]);
+        for (size_t i = 0; i < size; ++i) histogram[i].store(0.0f, std::memory_order_relaxed);
+        cdf.assign(size, 0.0f);
+
+        const size_t num_voxels = size / num_bins;
+        records.reset(new std::atomic<int>[num_voxels]);
+        for (size_t i = 0; i < num_voxels; ++i) records[i].store(0, std::memory_order_relaxed);
+        confidence.assign(num_voxels, 0.0f);
+    };
+
+bool path_guide::inside(const vec3& point) const {
+    return point.x >= bounds.lo.x && point.y >= bounds.lo.y && point.z >= bounds.lo.z &&
+           point.x <= bounds.hi.x && point.y <= bounds.hi.y && point.z <= bounds.hi.z;
+}
+
+int path_guide::voxel_index(const vec3& point) const {
+    vec3 extent = bounds.hi - bounds.lo;
+    auto cell = [&](float p, float lo, float ext) {
+        int c = ext > 0.0f ? static_cast<int>((p - lo) / ext * resolution) : 0;
+        return std::min(resolution - 1, std::max(0, c));
+    };
+    return (cell(point.z, bounds.lo.z, extent.z) * resolution + cell(point.y, bounds.lo.y, extent.y)) * resolution + cell(point.x, bounds.lo.x, extent.x);
+}
+
+int path_guide::direction_bin(const vec3& direction) const {
+    // Equal-area cylindrical mapping, every bin covers 4 pi / num_bins steradians
+    float u = 0.5f * (direction.z + 1.0f);
+    float v = (std::atan2(direction.y, direction.x) + static_cast<float>(M_PI)) / (2.0f * static_cast<float>(M_PI));
+    int bt = std::min(bins_theta - 1, std::max(0, static_cast<int>(u * bins_theta)));
+    int bp = std::min(bins_phi - 1, std::max(0, static_cast<int>(v * bins_phi)));
+    return bt * bins_phi + bp;
+}
+
+void path_guide::record(const vec3& point, const vec3& direction, float radiance) {
+    if (!(radiance > 0.0f) || !std::isfinite(radiance) || !inside(point)) return;
+
+    const int voxel = voxel_index(point);
+    records[voxel].fetch_add(1, std::memory_order_relaxed);
+
+    std::atomic<float>& bin = histogram[static_cast<size_t>(voxel) * num_bins + direction_bin(direction)];
+    float current = bin.load(std::memory_order_relaxed);
+    while (!bin.compare_exchange_weak(current, current + radiance, std::memory_order_relaxed)) {}
+}
+
+void path_guide::build() {
+    const int num_voxels = resolution * resolution * resolution;
+
+    for (int v = 0; v < num_voxels; ++v) {
+        const size_t base = static_cast<size_t>(v) * num_bins;
+
+        float total = 0.0f;
+        for (int b = 0; b < num_bins; ++b) total += histogram[base + b].load(std::memory_order_relaxed);
+
+        if (total <= 0.0f) {
+            std::fill(cdf.begin() + base, cdf.begin() + base + num_bins, 0.0f);
+            confidence[v] = 0.0f;
+            continue;
+        }
+
+        // Sparse histograms are noisy, ramp the guide in as a voxel gathers records
+        const float count = static_cast<float>(records[v].load(std::memory_order_relaxed));
+        confidence[v] = std::min(1.0f, count / static_cast<float>(std::max(1, min_records)));
+
+        // A small uniform floor keeps directions that were never sampled reachable
+        const float floor = 0.01f * total / static_cast<float>(num_bins);
+        float acc = 0.0f;
+        for (int b = 0; b < num_bins; ++b) {
+            acc += histogram[base + b].load(std::memory_order_relaxed) + floor;
+            cdf[base + b] = acc;
+        }
+        for (int b = 0; b < num_bins; ++b) cdf[base + b] /= acc;
+    }
+
+    built = true;
+}
+
+float path_guide::mix_at(const vec3& point) const {
+    if (!built || !inside(point)) return 0.0f;
+    return mix * confidence[voxel_index(point)];
+}
+
+bool path_guide::sample(const vec3& point, vec3& direction, float& pdf) const {
+    if (!built) return false;
+
+    const float* voxel_cdf = cdf.data() + static_cast<size_t>(voxel_index(point)) * num_bins;
+    if (voxel_cdf[num_bins - 1] <= 0.0f) return false;
+
+    int b = static_cast<int>(std::lower_bound(voxel_cdf, voxel_cdf + num_bins, randf01()) - voxel_cdf);
+    b = std::min(b, num_bins - 1);
+    float p_bin = voxel_cdf[b] - (b > 0 ? voxel_cdf[b - 1] : 0.0f);
+
+    // Uniform direction inside the bin
+    int bt = b / bins_phi;
+    int bp = b % bins_phi;
+    float z = 2.0f * (static_cast<float>(bt) + randf01()) / static_cast<float>(bins_theta) - 1.0f;
+    float phi = 2.0f * static_cast<float>(M_PI) * (static_cast<float>(bp) + randf01()) / static_cast<float>(bins_phi) - static_cast<float>(M_PI);
+    float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+
+    direction = vec3(r * std::cos(phi), r * std::sin(phi), z);
+    pdf = p_bin * static_cast<float>(num_bins) / (4.0f * static_cast<float>(M_PI));
+    return pdf > 0.0f;
+}
+
+float path_guide::pdf(const vec3& point, const vec3& direction) const {
+    if (!built) return 0.0f;
+
+    const float* voxel_cdf = cdf.data() + static_cast<size_t>(voxel_index(point)) * num_bins;
+    if (voxel_cdf[num_bins - 1] <= 0.0f) return 0.0f;
+
+    int b = direction_bin(direction);
+    float p_bin = voxel_cdf[b] - (b > 0 ? voxel_cdf[b - 1] : 0.0f);
+    return p_bin * static_cast<float>(num_bins) / (4.0f * static_cast<float>(M_PI));
+}
+
+// guided scatter function definition
+bool guided_scatter(const ray& in_ray, const hit_record& rec, const path_guide* guide, col3& attenuation, ray& scattered, float& pdf) {
+    bsdf_sample s;
+    s.specular = false;
+    bool sampled = rec.mat->sample(in_ray, rec, s);
+
+    vec3 guide_dir;
+    float guide_pdf = 0.0f;
+    float mix = (guide && !s.specular) ? guide->mix_at(rec.point) : 0.0f;
+    bool guided = mix > 0.0f;
+
+    if (!guided) {
+        if (!sampled) return false;
+        pdf = s.pdf;
+        attenuation = s.weight;
+        scattered = offset_ray(rec, s.direction);
+        return true;
+    }
+
+    // Pick a strategy first, a rejected BSDF sample is a zero sample of the BSDF strategy only
+    if (randf01() < mix) {
+        if (!guide->sample(rec.point, guide_dir, guide_pdf)) return false;
+        s.direction = guide_dir;
+    } else if (!sampled) {
+        return false;
+    }
+
+    // Weight by the mixture density, valid for either choice of strategy
+    float bsdf_density = rec.mat->pdf(in_ray.direction, s.direction, rec);
+    pdf = mix * guide->pdf(rec.point, s.direction) + (1.0f - mix) * bsdf_density;
+    if (pdf <= 0.0f) return false;
+
+    col3 f = rec.mat->eval(in_ray.direction, s.direction, rec);
+    if (f.r == 0.0f && f.g == 0.0f && f.b == 0.0f) return false;
+
+    float cos_out = std::abs(s.direction.dot(rec.normal));
+    attenuation = f * (cos_out / pdf);
+    scattered = offset_ray(rec, s.direction);
+    return true;
+};
+
+// visible bounds function definition
+aabb visible_bounds(const pinhole_cam& cam, const hittable_list& scene, int width, int height, float margin) {
+    aabb box;
+    hit_record rec;
+
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            float u = (static_cast<float>(x) + 0.5f) / static_cast<float>(width);
+            float v = (static_cast<float>(y) + 0.5f) / static_cast<float>(height);
+            if (scene.hit(cam.get_ray(1.0f - u, 1.0f - v), 1e-3f, 1e30f, rec)) box.expand(aabb(rec.point, rec.point));
+        }
+    }
+
+    if (box.empty()) return box;
+    vec3 pad(margin, margin, margin);
+    return aabb(box.lo - pad, box.hi + pad);
+};
+
+// guide training function definition
+void train_path_guide(path_guide& guide, const pinhole_cam& cam, const hittable_list& scene, const directional_light& dir_light, int width, int height, int passes, int aa_N) {
+    image scratch_img(width, height);
+
+    render_options opts;
+    opts.aa_N = aa_N;
+    opts.guide = &guide;
+
+    // Each pass samples with the guide built from the previous ones
+    guide.training = true;
+    for (int pass = 0; pass < passes; ++pass) {
+        render_async(cam, scene, scratch_img, dir_light, opts)->wait();
+        guide.build();
+    }
+    guide.training = false;
+};
+
+// direct light function definition
+col3 direct_light(const ray& r, const hit_record& rec, const hittable_list& scene, const directional_light& dir_light) {
+    vec3 to_light = -dir_light.direction;
+
+    float ndotl = rec.normal.dot(to_light);
+    if (ndotl <= 0.0f) return col3();
+
+    col3 f = rec.mat->eval(r.direction, to_light, rec);
+    if (f.r == 0.0f && f.g == 0.0f && f.b == 0.0f) return col3();   // Skip the shadow ray for specular materials
+
+    float visibility = 1.0f;
+    if (dir_light.shadow_map) {
+        visibility = dir_light.shadow_map->visibility(rec.point, rec.normal);
+        if (visibility <= 0.0f) return col3();
+    } else if (in_shadow(rec.point, rec.normal, to_light, scene)) {
+        return col3();
+    }
+
+    // Sun radiance is scaled by pi, so a white lambertian surface reflects it unchanged
+    return (f * dir_light.color) * (static_cast<float>(M_PI) * dir_light.radiance * ndotl * visibility);
+};
+
 // ray color function definition
 col3 ray_color(const ray& r, const hittable_list& scene, const directional_light& dir_light, int depth) {
+    return ray_color(r, scene, dir_light, depth, nullptr);
+};
+
+col3 ray_color(const ray& r, const hittable_list& scene, const directional_light& dir_light, int depth, path_guide* guide) {
     if (depth <= 0) {
         return col3(0.0f, 0.0f, 0.0f);
     }
@@ -357,20 +1027,21 @@ col3 ray_color(const ray& r, const hittable_list& scene, const directional_light
         return col3(0.01f, 0.01f, 0.01f);  // background color
     }
 
-    col3 color(0.0f, 0.0f, 0.0f);
-
-    vec3 to_light = -dir_light.direction;
-
-    if(!in_shadow(rec.point, rec.normal, to_light, scene)){
-        float ndotl = std::max(0.0f, rec.normal.dot(to_light));
-        color += (rec.mat->get_albedo() * dir_light.color) * (dir_light.radiance * ndotl);
-    }
+    col3 color = direct_light(r, rec, scene, dir_light);
     
     ray scattered(vec3(0, 0, 0), vec3(1, 0, 0));
     col3 attenuation;
+    float pdf = 0.0f;
 
-    if (rec.mat && rec.mat->scatter(r, rec, attenuation, scattered)) {
-        color += attenuation * ray_color(scattered, scene, dir_light, depth -1);
+    if (rec.mat && guided_scatter(r, rec, guide, attenuation, scattered, pdf)) {
+        col3 incident = ray_color(scattered, scene, dir_light, depth -1, guide);
+        color += attenuation * incident;
+
+        // Radiance divided by the sampling density estimates the per-bin integral, whatever the sampler
+        if (guide && guide->training && pdf > 0.0f) {
+            float luminance = 0.2126f * incident.r + 0.7152f * incident.g + 0.0722f * incident.b;
+            guide->record(rec.point, scattered.direction, luminance / pdf);
+        }
     }
     
     return color;
@@ -445,44 +1116,224 @@ inline col3 lambertian_shader(const hittable_list& scene, image& img, const poin
     }
 };
 
-// thread worker function definition
-static inline void worker_rows(const pinhole_cam& cam, const hittable_list& scene, image& img, const directional_light& dir_light, int y0, int y1, int aa_N) {
+// pixel shading function definition
+static inline col3 shade_pixel(const pinhole_cam& cam, const hittable_list& scene, const directional_light& dir_light, int x, int y, float inv_width, float inv_height, int aa_N, path_guide* guide) {
 
-    const float inv_width = 1.0f / static_cast<float>(img.width - 1);
-    const float inv_height = 1.0f / static_cast<float>(img.height - 1);
+    col3 rgb_acc;
 
-    // Reuse intersection record for efficiency, since it's thread-local
-    hit_record rec;
+    for (int aa_it = 0; aa_it < aa_N; ++aa_it){
+
+        float offset_px = (aa_N == 1) ? 0.5f : randf01();
+        float offset_py = (aa_N == 1) ? 0.5f : randf01();
+
+        float u = (static_cast<float>(x) + offset_px) * inv_width;
+        float v = (static_cast<float>(y) + offset_py) * inv_height;
+
+        ray cast_ray = cam.get_ray(1.0f - u, 1.0f - v);
+
+        constexpr int max_depth = 10;
+        rgb_acc += ray_color(cast_ray, scene, dir_light, max_depth, guide);
+
+    }
+    col3 rgb = rgb_acc / static_cast<float>(aa_N);      // [0, inf)
+    col3 rgb_mapped = reinhard_mapping(rgb);            // [0, 1)
+    return gamma_correction(rgb_mapped);                // [0, 1]
+};
+
+// tile rendering function definition
+static inline void render_tile(const pinhole_cam& cam, const hittable_list& scene, const directional_light& dir_light, int width, int height, const tile& t, int aa_N, std::uint8_t* dst, int stride, path_guide* guide) {
+
+    const float inv_width = 1.0f / static_cast<float>(width - 1);
+    const float inv_height = 1.0f / static_cast<float>(height - 1);
+
+    for (int y = t.y0; y < t.y1; ++y){
+        std::uint8_t* row = dst + static_cast<size_t>(y - t.y0) * stride;
+        for (int x = t.x0; x < t.x1; ++x){
+            col3 rgb = shade_pixel(cam, scene, dir_light, x, y, inv_width, inv_height, aa_N, guide);
+            std::uint8_t* px = row + 3 * (x - t.x0);
+            px[0] = static_cast<std::uint8_t>(rgb.r * 255.0f);
+            px[1] = static_cast<std::uint8_t>(rgb.g * 255.0f);
+            px[2] = static_cast<std::uint8_t>(rgb.b * 255.0f);
+        }
+    }
+};
+
+// path state class definition
+class path_state {
+    public:
+
+    ray r;
+    col3 throughput;
+    int pixel;              // Pixel index inside the tile
+    int depth;              // Remaining bounces
+    std::uint32_t key;      // Sort key, direction octant and origin Morton code
+
+    path_state(const ray& r, const col3& throughput, int pixel, int depth) : r(r), throughput(throughput), pixel(pixel), depth(depth), key(0) {};
+};
+
+// Morton code function definition
+static inline std::uint32_t morton_code(float x, float y, float z) {
+
+    // Interleave 10 bits per axis, coordinates are expected in [0, 1]
+    auto expand_bits = [](std::uint32_t v) {
+        v = (v * 0x00010001u) & 0xFF0000FFu;
+        v = (v * 0x00000101u) & 0x0F00F00Fu;
+        v = (v * 0x00000011u) & 0xC30C30C3u;
+        v = (v * 0x00000005u) & 0x49249249u;
+        return v;
+    };
+
+    std::uint32_t xi = static_cast<std::uint32_t>(clamp01(x) * 1023.0f);
+    std::uint32_t yi = static_cast<std::uint32_t>(clamp01(y) * 1023.0f);
+    std::uint32_t zi = static_cast<std::uint32_t>(clamp01(z) * 1023.0f);
+    return (expand_bits(xi) << 2) | (expand_bits(yi) << 1) | expand_bits(zi);
+}
+
+// path sorting function definition
+static inline void sort_paths(scratch_vector<path_state>& paths) {
+
+    if (paths.size() < 2) return;
+
+    // Origin bounds of the current batch, used to quantize the Morton code
+    vec3 lo = paths[0].r.origin;
+    vec3 hi = paths[0].r.origin;
+    for (const path_state& p : paths) {
+        lo = vec3(std::min(lo.x, p.r.origin.x), std::min(lo.y, p.r.origin.y), std::min(lo.z, p.r.origin.z));
+        hi = vec3(std::max(hi.x, p.r.origin.x), std::max(hi.y, p.r.origin.y), std::max(hi.z, p.r.origin.z));
+    }
+    vec3 extent = hi - lo;
+    vec3 inv_extent(
+        extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+        extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+        extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+
+    // Direction octant in the top bits, so rays first group by direction and then by origin
+    for (path_state& p : paths) {
+        const vec3& d = p.r.direction;
+        std::uint32_t octant = (d.x < 0.0f ? 4u : 0u) | (d.y < 0.0f ? 2u : 0u) | (d.z < 0.0f ? 1u : 0u);
+        vec3 o = p.r.origin - lo;
+        p.key = (octant << 29) | (morton_code(o.x * inv_extent.x, o.y * inv_extent.y, o.z * inv_extent.z) >> 1);
+    }
+
+    std::sort(paths.begin(), paths.end(), [](const path_state& a, const path_state& b) {
+        return a.key < b.key;
+    });
+};
+
+// sorted tile rendering function definition
+// Breadth-first version of render_tile: all paths of the tile advance one bounce at a time,
+// secondary rays are sorted before intersection and hits are shaded grouped by material.
+static inline void render_tile_sorted(const pinhole_cam& cam, const hittable_list& scene, const directional_light& dir_light, int width, int height, const tile& t, int aa_N, std::uint8_t* dst, int stride, const path_guide* guide) {
+
+    const float inv_width = 1.0f / static_cast<float>(width - 1);
+    const float inv_height = 1.0f / static_cast<float>(height - 1);
+    const int num_pixels = t.width() * t.height();
+
+    constexpr int max_depth = 10;
+    constexpr int max_batch = 16384;    // Bounds the path buffers of each thread
+    const int samples_per_batch = std::max(1, std::min(aa_N, max_batch / std::max(1, num_pixels)));
 
-    for (int y = y0; y < y1; ++y){
-        for (int x = 0; x < img.width; ++x){
+    const col3 background(0.01f, 0.01f, 0.01f);
 
-            col3 rgb_acc;
+    // Each tile is one scratch frame, buffers are sized once for the largest batch
+    scratch_arena& scratch = thread_scratch();
+    scratch.reset();
 
-            for (int aa_it = 0; aa_it < aa_N; ++aa_it){
+    const size_t batch_size = static_cast<size_t>(num_pixels) * samples_per_batch;
 
-                float offset_px = (aa_N == 1) ? 0.5f : randf01();
-                float offset_py = (aa_N == 1) ? 0.5f : randf01();
+    scratch_allocator<col3> alloc(scratch);
 
-                float u = (static_cast<float>(x) + offset_px) * inv_width;
-                float v = (static_cast<float>(y) + offset_py) * inv_height;
+    scratch_vector<col3> rgb_acc(num_pixels, col3(), alloc);
+    scratch_vector<path_state> paths(alloc);
+    scratch_vector<path_state> next_paths(alloc);
+    scratch_vector<hit_record> hits(alloc);
+    scratch_vector<int> shade_order(alloc);
+    paths.reserve(batch_size);
+    next_paths.reserve(batch_size);
+    hits.reserve(batch_size);
+    shade_order.reserve(batch_size);
 
-                ray cast_ray = cam.get_ray(1.0f - u, 1.0f - v);
+    for (int s0 = 0; s0 < aa_N; s0 += samples_per_batch) {
+        const int s1 = std::min(aa_N, s0 + samples_per_batch);
 
-                constexpr int max_depth = 10;
-                rgb_acc += ray_color(cast_ray, scene, dir_light, max_depth);
+        // Primary rays are already coherent, they are traced in pixel order
+        paths.clear();
+        for (int y = t.y0; y < t.y1; ++y) {
+            for (int x = t.x0; x < t.x1; ++x) {
+                const int pixel = (y - t.y0) * t.width() + (x - t.x0);
+                for (int aa_it = s0; aa_it < s1; ++aa_it) {
+                    float offset_px = (aa_N == 1) ? 0.5f : randf01();
+                    float offset_py = (aa_N == 1) ? 0.5f : randf01();
 
+                    float u = (static_cast<float>(x) + offset_px) * inv_width;
+                    float v = (static_cast<float>(y) + offset_py) * inv_height;
+
+                    paths.emplace_back(cam.get_ray(1.0f - u, 1.0f - v), col3(1.0f, 1.0f, 1.0f), pixel, max_depth);
+                }
+            }
+        }
+
+        for (int bounce = 0; !paths.empty(); ++bounce) {
+            if (bounce > 0) sort_paths(paths);
+
+            // Intersection pass
+            hits.resize(paths.size());
+            shade_order.clear();
+            for (size_t i = 0; i < paths.size(); ++i) {
+                if (scene.hit(paths[i].r, 1e-3f, 1e30f, hits[i])) {
+                    shade_order.push_back(static_cast<int>(i));
+                } else {
+                    rgb_acc[paths[i].pixel] += paths[i].throughput * background;
+                }
             }
-            col3 rgb = rgb_acc / static_cast<float>(aa_N);      // [0, inf)
-            col3 rgb_mapped = reinhard_mapping(rgb);            // [0, 1)
-            col3 rgb_corrected = gamma_correction(rgb_mapped);  // [0, 1]
-
-            img.set_pixel(x, y, 
-                        static_cast<std::uint8_t>(rgb_corrected.r * 255.0f),
-                        static_cast<std::uint8_t>(rgb_corrected.g * 255.0f),
-                        static_cast<std::uint8_t>(rgb_corrected.b * 255.0f));
+
+            // Shading pass, grouped by material
+            std::stable_sort(shade_order.begin(), shade_order.end(), [&](int a, int b) {
+                return hits[a].mat < hits[b].mat;
+            });
+
+            next_paths.clear();
+            for (int i : shade_order) {
+                const path_state& p = paths[i];
+                const hit_record& rec = hits[i];
+
+                rgb_acc[p.pixel] += p.throughput * direct_light(p.r, rec, scene, dir_light);
+
+                ray scattered(vec3(0, 0, 0), vec3(1, 0, 0));
+                col3 attenuation;
+                float pdf;
+
+                // A path with one bounce left would return black from ray_color, it is dropped here
+                // The guide is only sampled here, training needs the recursive integrator
+                if (p.depth > 1 && rec.mat && guided_scatter(p.r, rec, guide, attenuation, scattered, pdf)) {
+                    next_paths.emplace_back(scattered, p.throughput * attenuation, p.pixel, p.depth - 1);
+                }
+            }
+
+            paths.swap(next_paths);
         }
     }
+
+    for (int y = t.y0; y < t.y1; ++y){
+        std::uint8_t* row = dst + static_cast<size_t>(y - t.y0) * stride;
+        for (int x = t.x0; x < t.x1; ++x){
+            col3 rgb = rgb_acc[(y - t.y0) * t.width() + (x - t.x0)] / static_cast<float>(aa_N);   // [0, inf)
+            col3 rgb_corrected = gamma_correction(reinhard_mapping(rgb));                           // [0, 1]
+            std::uint8_t* px = row + 3 * (x - t.x0);
+            px[0] = static_cast<std::uint8_t>(rgb_corrected.r * 255.0f);
+            px[1] = static_cast<std::uint8_t>(rgb_corrected.g * 255.0f);
+            px[2] = static_cast<std::uint8_t>(rgb_corrected.b * 255.0f);
+        }
+    }
+};
+
+// thread worker function definition
+static inline void worker_rows(const pinhole_cam& cam, const hittable_list& scene, image& img, const directional_light& dir_light, int y0, int y1, int aa_N) {
+
+    // Rows are written in place, the image buffer is the tile buffer
+    tile rows{0, y0, img.width, y1};
+    std::uint8_t* dst = img.rgb.data() + static_cast<size_t>(y0) * img.width * 3;
+    render_tile(cam, scene, dir_light, img.width, img.height, rows, aa_N, dst, img.width * 3, nullptr);
 };
 
 // rendering function declaration
@@ -495,9 +1346,7 @@ void render(const pinhole_cam& cam, const hittable_list& scene, image& img, cons
 
     if (img.width <= 1 || img.height <= 1) return;
 
-    unsigned int num_threads = std::thread::hardware_concurrency();
-    if (num_threads == 0) num_threads = 4; // Fallback to 4 threads if hardware_concurrency cannot determine
-    num_threads = std::min(num_threads, static_cast<unsigned int>(img.height)); // Limit threads to image height
+    unsigned int num_threads = render_thread_count(static_cast<unsigned int>(img.height)); // Limit threads to image height
 
     std::cout << "Using " << num_threads << " threads for rendering\n";
 
@@ -514,4 +1363,260 @@ void render(const pinhole_cam& cam, const hittable_list& scene, image& img, cons
     }
 
     for (auto& th : threads) th.join();
-};
\ No newline at end of file
+};
+
+// tiled rendering function definition
+void render_tiled(const pinhole_cam& cam, const hittable_list& scene, tiled_image& img, const directional_light& dir_light, int aa_N) {
+
+    if (aa_N < 1) {
+        aa_N = 1;
+        std::cout << "Anti-aliasing samples set to 1\n";
+    }
+
+    if (img.width <= 1 || img.height <= 1 || !img.is_open()) return;
+
+    const int num_tiles = img.num_tiles();
+
+    unsigned int num_threads = render_thread_count(static_cast<unsigned int>(num_tiles)); // Limit threads to tile count
+
+    std::cout << "Using " << num_threads << " threads for tiled rendering (" << num_tiles << " tiles)\n";
+
+    // Tiles are handed out dynamically, each thread owns a single tile buffer
+    std::atomic<int> next_tile(0);
+
+    auto worker = [&]() {
+        std::vector<std::uint8_t> buffer(static_cast<size_t>(img.tile_size) * img.tile_size * 3);
+        for (int id = next_tile++; id < num_tiles; id = next_tile++) {
+            tile t = img.get_tile(id);
+            const int stride = t.width() * 3;
+            render_tile(cam, scene, dir_light, img.width, img.height, t, aa_N, buffer.data(), stride, nullptr);
+            if (!img.write_tile(t, buffer.data(), stride)) {
+                std::cerr << "Failed to write tile " << id << "\n";
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads);
+    for (unsigned int t = 0; t < num_threads; ++t) threads.emplace_back(worker);
+    for (auto& th : threads) th.join();
+};
+
+// render job class member function definitions
+render_job::~render_job() {
+    cancel();
+    wait();
+}
+
+float render_job::progress() const {
+    if (error) return 0.0f;
+    if (tiles.empty()) return 1.0f;
+    return static_cast<float>(tiles_finished.load()) / static_cast<float>(tiles.size());
+}
+
+void render_job::cancel() {
+    cancel_flag = true;
+}
+
+void render_job::wait() {
+    std::lock_guard<std::mutex> lock(join_mutex);
+    for (auto& th : threads) {
+        if (th.joinable()) th.join();
+    }
+}
+
+// tile cost estimation function definition
+static inline int estimate_tile_cost(const pinhole_cam& cam, const hittable_list& scene, int width, int height, const tile& t) {
+
+    // Probe the tile corners and center, cost is the number of rays traced along each path
+    const float px[5] = {static_cast<float>(t.x0), static_cast<float>(t.x1 - 1), static_cast<float>(t.x0), static_cast<float>(t.x1 - 1), 0.5f * (t.x0 + t.x1 - 1)};
+    const float py[5] = {static_cast<float>(t.y0), static_cast<float>(t.y0), static_cast<float>(t.y1 - 1), static_cast<float>(t.y1 - 1), 0.5f * (t.y0 + t.y1 - 1)};
+
+    const float inv_width = 1.0f / static_cast<float>(width - 1);
+    const float inv_height = 1.0f / static_cast<float>(height - 1);
+
+    int cost = 0;
+    hit_record rec;
+
+    for (int i = 0; i < 5; ++i) {
+        ray probe = cam.get_ray(1.0f - (px[i] + 0.5f) * inv_width, 1.0f - (py[i] + 0.5f) * inv_height);
+
+        constexpr int max_depth = 10;
+        for (int depth = 0; depth < max_depth; ++depth) {
+            ++cost;
+            if (!scene.hit(probe, 1e-3f, 1e30f, rec)) break;
+            ++cost;     // Shadow ray
+
+            col3 attenuation;
+            ray scattered(vec3(0, 0, 0), vec3(1, 0, 0));
+            if (!rec.mat || !rec.mat->scatter(probe, rec, attenuation, scattered)) break;
+            probe = scattered;
+        }
+    }
+
+    return cost;
+};
+
+// tile cost sorting function definition
+static inline void sort_tiles_by_cost(std::vector<tile>& tiles, const std::vector<int>& costs) {
+    // Longest tiles first, so that no thread is left with an expensive tile at the end
+    std::vector<int> order(tiles.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = static_cast<int>(i);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        return costs[a] > costs[b];
+    });
+
+    std::vector<tile> sorted;
+    sorted.reserve(tiles.size());
+    for (int i : order) sorted.push_back(tiles[i]);
+    tiles.swap(sorted);
+};
+
+// tile list function definition
+std::vector<tile> make_tiles(int width, int height, int tile_size, tile_order order, const pinhole_cam& cam, const hittable_list& scene) {
+
+    tile_size = std::max(1, tile_size);
+
+    std::vector<tile> tiles;
+    for (int y0 = 0; y0 < height; y0 += tile_size) {
+        for (int x0 = 0; x0 < width; x0 += tile_size) {
+            tiles.push_back(tile{x0, y0, std::min(x0 + tile_size, width), std::min(y0 + tile_size, height)});
+        }
+    }
+
+    if (order == tile_order::center_first) {
+        auto center_dist = [&](const tile& t) {
+            float dx = 0.5f * (t.x0 + t.x1 - width);
+            float dy = 0.5f * (t.y0 + t.y1 - height);
+            return dx * dx + dy * dy;
+        };
+        std::stable_sort(tiles.begin(), tiles.end(), [&](const tile& a, const tile& b) {
+            return center_dist(a) < center_dist(b);
+        });
+    } else if (order == tile_order::cost_first) {
+        std::vector<int> costs;
+        costs.reserve(tiles.size());
+        for (const tile& t : tiles) costs.push_back(estimate_tile_cost(cam, scene, width, height, t));
+        sort_tiles_by_cost(tiles, costs);
+    }
+
+    return tiles;
+};
+
+// asynchronous rendering function definition
+std::unique_ptr<render_job> render_async(const pinhole_cam& cam, const hittable_list& scene, image& img, const directional_light& dir_light, const render_options& opts) {
+    return render_batch_async({cam}, scene, {&img}, dir_light, opts);
+};
+
+// asynchronous batch rendering function definition
+std::unique_ptr<render_job> render_batch_async(const std::vector<pinhole_cam>& cams, const hittable_list& scene, const std::vector<image*>& imgs, const directional_light& dir_light, const render_options& opts) {
+
+    std::unique_ptr<render_job> job(new render_job());
+
+    // Every camera needs its own target image, an invalid batch renders nothing
+    if (cams.size() != imgs.size()) {
+        std::cerr << "render_batch_async: " << cams.size() << " cameras but " << imgs.size() << " images\n";
+        job->error = true;
+        return job;
+    }
+    for (size_t v = 0; v < imgs.size(); ++v) {
+        if (!imgs[v]) {
+            std::cerr << "render_batch_async: null image for view " << v << "\n";
+            job->error = true;
+            return job;
+        }
+        // Two views writing into the same buffer would race
+        if (std::find(imgs.begin(), imgs.begin() + v, imgs[v]) != imgs.begin() + v) {
+            std::cerr << "render_batch_async: image of view " << v << " is shared with another view\n";
+            job->error = true;
+            return job;
+        }
+    }
+
+    // Per-view tile lists, each in the requested priority order
+    const size_t num_views = cams.size();
+    std::vector<std::vector<tile>> view_tiles(num_views);
+    size_t max_tiles = 0;
+    for (size_t v = 0; v < num_views; ++v) {
+        const image& img = *imgs[v];
+        if (img.width <= 1 || img.height <= 1) continue;
+
+        // Costs are estimated by the workers, the caller only builds the tile grid
+        tile_order order = (opts.order == tile_order::cost_first) ? tile_order::scanline : opts.order;
+        view_tiles[v] = make_tiles(img.width, img.height, opts.tile_size, order, cams[v], scene);
+        for (tile& t : view_tiles[v]) t.view = static_cast<int>(v);
+        max_tiles = std::max(max_tiles, view_tiles[v].size());
+    }
+
+    // Interleave the views, so tiles of neighbouring views looking at the same geometry run back to back
+    for (size_t i = 0; i < max_tiles; ++i) {
+        for (size_t v = 0; v < num_views; ++v) {
+            if (i < view_tiles[v].size()) job->tiles.push_back(view_tiles[v][i]);
+        }
+    }
+
+    const int num_tiles = job->num_tiles();
+    if (num_tiles == 0) return job;
+    const int aa_N = std::max(1, opts.aa_N);
+
+    unsigned int num_threads = render_thread_count(static_cast<unsigned int>(num_tiles)); // Limit threads to tile count
+
+    if (opts.order == tile_order::cost_first) {
+        job->tile_costs.assign(num_tiles, 0);
+        job->workers_estimating = static_cast<int>(num_threads);
+        job->tiles_ordered = false;
+    }
+
+    // Worker state is copied, so the caller's cameras, light and options may go out of scope
+    auto worker = [job = job.get(), cams, &scene, imgs, dir_light, aa_N, on_tile = opts.on_tile, sort_rays = opts.sort_rays, guide = opts.guide, estimate_costs = !job->tiles_ordered]() {
+        const int num_tiles = job->num_tiles();
+
+        if (estimate_costs) {
+            for (int id = job->next_cost++; id < num_tiles && !job->cancel_flag; id = job->next_cost++) {
+                const tile& t = job->tiles[id];
+                job->tile_costs[id] = estimate_tile_cost(cams[t.view], scene, imgs[t.view]->width, imgs[t.view]->height, t);
+            }
+
+            // The last worker to finish probing orders the tiles, the others wait for it
+            std::unique_lock<std::mutex> lock(job->order_mutex);
+            if (--job->workers_estimating == 0) {
+                sort_tiles_by_cost(job->tiles, job->tile_costs);
+                job->tiles_ordered = true;
+                job->order_cv.notify_all();
+            } else {
+                job->order_cv.wait(lock, [job]() { return job->tiles_ordered; });
+            }
+        }
+
+        for (int id = job->next_tile++; id < num_tiles && !job->cancel_flag; id = job->next_tile++) {
+            const tile& t = job->tiles[id];
+            const pinhole_cam& cam = cams[t.view];
+            image& img = *imgs[t.view];
+
+            const int stride = img.width * 3;
+            std::uint8_t* dst = img.rgb.data() + (static_cast<size_t>(t.y0) * img.width + t.x0) * 3;
+            if (sort_rays) {
+                render_tile_sorted(cam, scene, dir_light, img.width, img.height, t, aa_N, dst, stride, guide);
+            } else {
+                render_tile(cam, scene, dir_light, img.width, img.height, t, aa_N, dst, stride, guide);
+            }
+            // Counted after the callback, so progress() == 1 means every callback has returned
+            if (on_tile) on_tile(t, dst, stride);
+            ++job->tiles_finished;
+        }
+        --job->workers_left;
+    };
+
+    job->workers_left = static_cast<int>(num_threads);
+    job->threads.reserve(num_threads);
+    for (unsigned int t = 0; t < num_threads; ++t) job->threads.emplace_back(worker);
+
+    return job;
+};
+
+// batch rendering function definition
+bool render_batch(const std::vector<pinhole_cam>& cams, const hittable_list& scene, const std::vector<image*>& imgs, const directional_light& dir_light, const render_options& opts) {
+    std::unique_ptr<render_job> job = render_batch_async(cams, scene, imgs, dir_light, opts);
+    job->wait();
+    return !job->failed();
+};
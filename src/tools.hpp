@@ -3,6 +3,16 @@
 #include <string>
 #include <cstdint>
 #include <memory>
+#include <fstream>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <cstddef>
 
 // vec3 class declaration
 class vec3{
@@ -91,6 +101,47 @@ class image{
     bool write_ppm(const std::string& filepath) const;
 };
 
+// tile class declaration
+class tile {
+    public:
+
+    int x0, y0, x1, y1;     // Pixel bounds, [x0, x1) x [y0, y1)
+    int view = 0;           // Camera index when rendering a batch of views
+
+    int width() const { return x1 - x0; };
+    int height() const { return y1 - y0; };
+};
+
+// tiled image class declaration
+// Out-of-core framebuffer: pixels are never held for the whole image, finished
+// tiles are streamed straight to their final position in the output PPM file.
+// Peak memory is one tile buffer per render thread, independent of resolution.
+class tiled_image {
+    public:
+
+    int width, height;
+    int tile_size;
+
+    tiled_image(int width, int height, int tile_size, const std::string& filepath);
+
+    bool is_open() const { return out.is_open(); };
+
+    int tiles_x() const;
+    int tiles_y() const;
+    int num_tiles() const;
+    tile get_tile(int id) const;
+
+    // Thread-safe, rgb points to the tile top-left pixel, stride is in bytes
+    bool write_tile(const tile& t, const std::uint8_t* rgb, int stride);
+
+    bool close();
+
+    private:
+    std::fstream out;
+    std::streamoff data_offset;
+    std::mutex out_mutex;
+};
+
 // gradient image generation function declaration
 void gradient_image(int width, int height, const std::string& filepath);
 
@@ -105,18 +156,36 @@ class hit_record {
     vec3 point;
     vec3 normal;
 
-    std::shared_ptr<material> mat;
+    const material* mat;    // Non-owning, the scene keeps materials alive
     bool front_face;    // External vs internal surface
 
     void set_face_normal(const ray& cast_ray, const vec3& out_normal);
 };
 
+// bsdf sample class declaration
+class bsdf_sample {
+    public:
+
+    vec3 direction;     // Sampled scattering direction, normalized
+    col3 weight;        // f * cos / pdf, multiplies the radiance carried back along direction
+    float pdf;          // Solid angle density, 0 for specular (delta) lobes
+    bool specular;
+};
+
 // material class declaration
+// sample() draws a scattering direction, eval() returns the BSDF value f (without cosine)
+// and pdf() the solid angle density sample() would use, so callers can weight or mix strategies.
+// Specular lobes are only reachable through sample(), eval() and pdf() return zero for them.
 class material {
     public:
 
-    virtual col3 get_albedo() const = 0; 
-    virtual bool scatter(const ray& in_ray, const hit_record& rec, col3& attenuation, ray& scattered) const = 0;
+    virtual ~material() = default;
+
+    virtual bool sample(const ray& in_ray, const hit_record& rec, bsdf_sample& s) const = 0;
+    virtual col3 eval(const vec3& in_dir, const vec3& out_dir, const hit_record& rec) const = 0;
+    virtual float pdf(const vec3& in_dir, const vec3& out_dir, const hit_record& rec) const = 0;
+
+    bool scatter(const ray& in_ray, const hit_record& rec, col3& attenuation, ray& scattered) const;
 };
 
 // lambertian material class declaration
@@ -126,8 +195,9 @@ class lambertian : public material{
     col3 albedo;
     lambertian(const col3& albedo);
 
-    col3 get_albedo() const override {return albedo; };
-    bool scatter(const ray& in_ray, const hit_record& rec, col3& attenuation, ray& scattered) const override;
+    bool sample(const ray& in_ray, const hit_record& rec, bsdf_sample& s) const override;
+    col3 eval(const vec3& in_dir, const vec3& out_dir, const hit_record& rec) const override;
+    float pdf(const vec3& in_dir, const vec3& out_dir, const hit_record& rec) const override;
 
 };
 
@@ -138,17 +208,63 @@ class metal : public material{
     col3 albedo;
     metal(const col3& albedo);
 
-    col3 get_albedo() const override {return albedo; };
-    bool scatter(const ray& in_ray, const hit_record& rec, col3& attenuation, ray& scattered) const override;
+    bool sample(const ray& in_ray, const hit_record& rec, bsdf_sample& s) const override;
+    col3 eval(const vec3& /*in_dir*/, const vec3& /*out_dir*/, const hit_record& /*rec*/) const override {return col3(); };
+    float pdf(const vec3& /*in_dir*/, const vec3& /*out_dir*/, const hit_record& /*rec*/) const override {return 0.0f; };
 
 };
 
+// glossy material class declaration
+// GGX microfacet reflection, albedo is the normal incidence reflectance (Schlick F0)
+class glossy : public material{
+    public:
+
+    col3 albedo;
+    float roughness;    // Perceptual roughness, alpha = roughness^2
+    glossy(const col3& albedo, float roughness);
+
+    bool sample(const ray& in_ray, const hit_record& rec, bsdf_sample& s) const override;
+    col3 eval(const vec3& in_dir, const vec3& out_dir, const hit_record& rec) const override;
+    float pdf(const vec3& in_dir, const vec3& out_dir, const hit_record& rec) const override;
+
+    private:
+    float alpha;
+};
+
+// dielectric material class declaration
+// Smooth glass, reflection or refraction is chosen with the Schlick Fresnel term
+class dielectric : public material{
+    public:
+
+    float ior;
+    dielectric(float ior);
+
+    bool sample(const ray& in_ray, const hit_record& rec, bsdf_sample& s) const override;
+    col3 eval(const vec3& /*in_dir*/, const vec3& /*out_dir*/, const hit_record& /*rec*/) const override {return col3(); };
+    float pdf(const vec3& /*in_dir*/, const vec3& /*out_dir*/, const hit_record& /*rec*/) const override {return 0.0f; };
+
+};
+
+// axis aligned bounding box class declaration
+class aabb {
+    public:
+
+    vec3 lo, hi;
+
+    aabb() : lo(1e30f, 1e30f, 1e30f), hi(-1e30f, -1e30f, -1e30f) {};   // Default constructor initializes to an empty box
+    aabb(const vec3& lo, const vec3& hi) : lo(lo), hi(hi) {};
+
+    void expand(const aabb& box);
+    bool empty() const { return hi.x < lo.x || hi.y < lo.y || hi.z < lo.z; };
+};
+
 // hittable class declaration
 class hittable {
     public:
 
     virtual ~hittable() = default;
     virtual bool hit(const ray& ray, float t_min, float t_max, hit_record& rec) const = 0;
+    virtual bool bounding_box(aabb& box) const = 0;
 };
 
 // sphere class declaration
@@ -157,24 +273,128 @@ class sphere : public hittable{
 
     vec3 center;
     float radius;
-    std::shared_ptr<material> mat;
+    const material* mat;                    // Non-owning, held by a scene_arena or hittable_list::keep
 
-    sphere(const vec3& center, float radius, std::shared_ptr<material> mat);
+    sphere(const vec3& center, float radius, const material* mat);     // mat must outlive the sphere
 
     bool hit(const ray& ray, float t_min, float t_max, hit_record& rec) const override;
+    bool bounding_box(aabb& box) const override;
 };
 
 // hittable list class declaration
 class hittable_list : public hittable{
     public:
 
-    std::vector<std::shared_ptr<hittable>> objects;
+    std::vector<const hittable*> objects;               // Traversal list, owning and non-owning entries alike
+    std::vector<std::shared_ptr<hittable>> owned;       // Keeps heap allocated objects alive
+    std::vector<std::shared_ptr<material>> materials;   // Keeps heap allocated materials alive
 
     void add(std::shared_ptr<hittable> object);
+    void add(const hittable* object);                   // Non-owning, object must outlive the list
+    const material* keep(std::shared_ptr<material> mat); // Ties a heap allocated material to the list
 
     bool hit(const ray& ray, float t_min, float t_max, hit_record& rec) const override;
+    bool bounding_box(aabb& box) const override;
 };
 
+// scene arena class declaration
+// Places scene objects (primitives, materials, acceleration nodes) back to back in large blocks.
+// make() returns plain pointers owned by the arena, to be stored through the non-owning scene
+// overloads. The arena must outlive every scene built from it, teardown frees whole blocks.
+class scene_arena {
+    public:
+
+    explicit scene_arena(size_t block_size = size_t(1) << 21, bool huge_pages = false);
+    ~scene_arena();
+
+    scene_arena(const scene_arena&) = delete;
+    scene_arena& operator=(const scene_arena&) = delete;
+
+    void* allocate(size_t size, size_t align);
+
+    template<class T, class... Args>
+    T* make(Args&&... args) {
+        T* obj = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        if (!std::is_trivially_destructible<T>::value) {
+            destructors.push_back({obj, [](void* p) { static_cast<T*>(p)->~T(); }});
+        }
+        return obj;
+    }
+
+    size_t bytes_used() const { return used; };
+
+    private:
+    class block {
+        public:
+        std::uint8_t* data;
+        size_t size;
+        bool mapped;    // Allocated with mmap rather than operator new
+    };
+
+    class destructor {
+        public:
+        void* obj;
+        void (*destroy)(void*);
+    };
+
+    size_t block_size;
+    bool huge_pages;
+    std::vector<block> blocks;
+    std::vector<destructor> destructors;
+    size_t offset = 0;  // Bump pointer inside the last block
+    size_t used = 0;
+};
+
+// scratch arena class declaration
+// Per-thread bump allocator for transient render data. reset() rewinds without freeing,
+// so after the first tile a thread renders without touching the global heap.
+class scratch_arena {
+    public:
+
+    scratch_arena() = default;
+    ~scratch_arena();
+
+    scratch_arena(const scratch_arena&) = delete;
+    scratch_arena& operator=(const scratch_arena&) = delete;
+
+    void* allocate(size_t size, size_t align);
+    void reset();
+
+    private:
+    std::vector<std::pair<std::uint8_t*, size_t>> blocks;
+    size_t current = 0;     // Block being bumped
+    size_t offset = 0;
+};
+
+// thread scratch function declaration
+scratch_arena& thread_scratch();
+
+// scratch allocator class declaration
+// Standard allocator adaptor, deallocation is a no-op until the arena is reset
+template<class T>
+class scratch_allocator {
+    public:
+
+    using value_type = T;
+
+    scratch_arena* arena;
+
+    explicit scratch_allocator(scratch_arena& arena) : arena(&arena) {};
+    template<class U>
+    scratch_allocator(const scratch_allocator<U>& other) : arena(other.arena) {};
+
+    T* allocate(size_t n) { return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T))); };
+    void deallocate(T*, size_t) {};
+
+    template<class U>
+    bool operator==(const scratch_allocator<U>& other) const { return arena == other.arena; };
+    template<class U>
+    bool operator!=(const scratch_allocator<U>& other) const { return arena != other.arena; };
+};
+
+template<class T>
+using scratch_vector = std::vector<T, scratch_allocator<T>>;
+
 // camera class declaration
 class camera {
     virtual ray get_ray(float u, float v) const = 0;
@@ -219,16 +439,42 @@ class point_light : public light {
     point_light(const vec3& position, float intensity);
 };
 
+// sun shadow map class forward declaration
+class sun_shadow_map;
+
 // directional light class declaration
 class directional_light : public light {
     public:
     vec3 direction;
     col3 color;
     float radiance;
+    const sun_shadow_map* shadow_map = nullptr;     // Optional occlusion cache, replaces shadow rays when set
 
     directional_light(const vec3& direction, const col3& color, const float& radiance);
 };
 
+// sun shadow map class declaration
+// Orthographic depth map in light space for static scenes. Built once per frame in parallel, then sun
+// visibility is a filtered lookup instead of a shadow ray. Must be rebuilt if the sun or the scene moves.
+class sun_shadow_map {
+    public:
+
+    float bias;             // Constant depth tolerance in world units, a slope term is added per lookup
+    int filter_radius;      // Percentage closer filtering radius in texels, 0 gives hard single-tap shadows
+
+    sun_shadow_map(const directional_light& dir_light, const aabb& bounds, int resolution = 2048, float bias = 1e-2f, int filter_radius = 1);
+
+    void build(const hittable_list& scene);
+    float visibility(const vec3& point, const vec3& normal) const;     // [0, 1]
+
+    private:
+    vec3 light_dir, axis_u, axis_v;
+    float u_min, v_min, d_min;
+    float texel_size;
+    int resolution;
+    std::vector<float> depth;   // Light space depth of the first occluder, row major
+};
+
 // random function declaration
 float randf01();
 
@@ -238,6 +484,15 @@ float clamp01(float x);
 // random vector function declaration
 vec3 rand_vec();
 
+// cosine weighted hemisphere sampling function declaration
+vec3 rand_cosine_dir(const vec3& n);
+
+// orthonormal basis function declaration
+void orthonormal_basis(const vec3& n, vec3& t, vec3& b);
+
+// Schlick Fresnel function declaration
+float schlick(float cosine, float f0);
+
 // Reinhard tone mapping function declaration
 col3 reinhard_mapping(const col3& c);
 
@@ -247,8 +502,64 @@ col3 gamma_correction(const col3& c);
 // in shadow function declaration
 bool in_shadow(const vec3& point, const vec3& out_normal, const vec3& light_dir, const hittable_list& scene);
 
+// path guide class declaration
+// Online learned radiance cache: a voxel grid over the scene, each voxel holding a histogram of
+// incident radiance over equal-area direction bins (cos theta x phi). Render threads record
+// lock-free while training, build() turns the histograms into sampling distributions between passes.
+class path_guide {
+    public:
+
+    float mix = 0.5f;       // Probability of sampling the guide instead of the BSDF in a fully trained voxel
+    int min_records = 256;  // Records a voxel needs before it gets the full mix, fewer scale it down linearly
+    bool training = false;  // Record incident radiance while rendering, train_path_guide turns it on
+
+    path_guide(const aabb& bounds, int resolution = 16, int dir_resolution = 8);
+
+    void record(const vec3& point, const vec3& direction, float radiance);
+    void build();
+    bool ready() const { return built; };
+    float mix_at(const vec3& point) const;  // Guide probability at point, 0 outside the grid or without data
+
+    // Sampling and density at a point, both fail or return 0 where the voxel has no data yet
+    bool sample(const vec3& point, vec3& direction, float& pdf) const;
+    float pdf(const vec3& point, const vec3& direction) const;
+
+    private:
+    aabb bounds;
+    int resolution;
+    int bins_theta, bins_phi, num_bins;
+    bool built = false;
+
+    std::unique_ptr<std::atomic<float>[]> histogram;   // Training data, voxel major
+    std::unique_ptr<std::atomic<int>[]> records;        // Training records per voxel
+    std::vector<float> cdf;                             // Per voxel inclusive CDF, empty voxels are all zero
+    std::vector<float> confidence;                      // Per voxel min(1, records / min_records)
+
+    bool inside(const vec3& point) const;
+    int voxel_index(const vec3& point) const;
+    int direction_bin(const vec3& direction) const;
+};
+
+// visible bounds function declaration
+// Box around the primary hits of a width x height probe, grown by margin on each side.
+// Fits a path_guide grid to the part of the scene the camera sees instead of its full extent.
+aabb visible_bounds(const pinhole_cam& cam, const hittable_list& scene, int width, int height, float margin);
+
+// guided scatter function declaration
+// Mixes BSDF and guide sampling for non-specular materials (one-sample MIS with the mixture pdf).
+// pdf is the density of the returned direction, 0 for specular scattering.
+bool guided_scatter(const ray& in_ray, const hit_record& rec, const path_guide* guide, col3& attenuation, ray& scattered, float& pdf);
+
+// guide training function declaration
+// Renders low sample count passes at width x height, rebuilding the guide after each one
+void train_path_guide(path_guide& guide, const pinhole_cam& cam, const hittable_list& scene, const directional_light& dir_light, int width, int height, int passes, int aa_N);
+
+// direct light function declaration
+col3 direct_light(const ray& r, const hit_record& rec, const hittable_list& scene, const directional_light& dir_light);
+
 // ray color function declaration
 col3 ray_color(const ray& r, const hittable_list& scene, const directional_light& dir_light, int depth);
+col3 ray_color(const ray& r, const hittable_list& scene, const directional_light& dir_light, int depth, path_guide* guide);
 
 // gradient shader function declaration
 inline col3 gradient_shader(const hittable_list& scene, image& img, const ray& cast_ray, hit_record& rec);
@@ -263,4 +574,93 @@ inline col3 lambertian_shader(const hittable_list& scene, image& img, const poin
 static inline void worker_rows(const pinhole_cam& cam, const hittable_list& scene, image& img, const directional_light& dir_light, int y0, int y1, int aa_N);
 
 // rendering function declaration
-void render(const pinhole_cam& cam, const hittable_list& scene, image& img, const directional_light& dir_light, int aa_N);
\ No newline at end of file
+void render(const pinhole_cam& cam, const hittable_list& scene, image& img, const directional_light& dir_light, int aa_N);
+
+// tiled rendering function declaration
+void render_tiled(const pinhole_cam& cam, const hittable_list& scene, tiled_image& img, const directional_light& dir_light, int aa_N);
+
+// tile order enum declaration
+enum class tile_order {
+    scanline,       // Row-major, top to bottom
+    center_first,   // Closest to the image center first
+    cost_first      // Most expensive first, estimated with probe rays
+};
+
+// tile callback type declaration
+// rgb points to the tile top-left pixel inside the target image, stride is in bytes.
+// Called from render threads as soon as the tile is finished, the data is not copied.
+using tile_callback = std::function<void(const tile& t, const std::uint8_t* rgb, int stride)>;
+
+// render options class declaration
+class render_options {
+    public:
+
+    int aa_N = 1;
+    int tile_size = 32;
+    tile_order order = tile_order::center_first;
+    tile_callback on_tile;
+    bool sort_rays = false;     // Trace the tile breadth-first with sorted secondary rays
+    path_guide* guide = nullptr;    // Optional path guiding cache, must outlive the job
+};
+
+// render job class declaration
+// Handle to a render running in the background. Cancellation is cooperative and
+// checked between tiles. Destroying the handle cancels the job and waits for it.
+// The scene and the target image must outlive the job.
+class render_job {
+    public:
+
+    render_job(const render_job&) = delete;
+    render_job& operator=(const render_job&) = delete;
+    ~render_job();
+
+    int num_tiles() const { return static_cast<int>(tiles.size()); };
+    int tiles_done() const { return tiles_finished.load(); };
+    float progress() const;     // [0, 1]
+
+    void cancel();
+    bool is_cancelled() const { return cancel_flag.load(); };
+
+    bool done() const { return workers_left.load() == 0; };
+    bool failed() const { return error; };     // Invalid input, nothing was rendered
+    void wait();
+
+    private:
+    render_job() = default;
+
+    std::vector<tile> tiles;
+    std::atomic<int> next_tile{0};
+    std::atomic<int> tiles_finished{0};
+    std::atomic<int> workers_left{0};
+    std::atomic<bool> cancel_flag{false};
+    bool error = false;
+
+    // Cost estimation phase for tile_order::cost_first, workers probe tiles then the last one sorts them
+    std::vector<int> tile_costs;
+    std::atomic<int> next_cost{0};
+    int workers_estimating = 0;
+    bool tiles_ordered = true;
+    std::mutex order_mutex;
+    std::condition_variable order_cv;
+
+    std::vector<std::thread> threads;
+    std::mutex join_mutex;
+
+    friend std::unique_ptr<render_job> render_batch_async(const std::vector<pinhole_cam>& cams, const hittable_list& scene, const std::vector<image*>& imgs, const directional_light& dir_light, const render_options& opts);
+};
+
+// tile list function declaration
+// cost_first traces probe paths on the calling thread, render_async runs that phase on its workers instead
+std::vector<tile> make_tiles(int width, int height, int tile_size, tile_order order, const pinhole_cam& cam, const hittable_list& scene);
+
+// asynchronous rendering function declaration
+std::unique_ptr<render_job> render_async(const pinhole_cam& cam, const hittable_list& scene, image& img, const directional_light& dir_light, const render_options& opts);
+
+// asynchronous batch rendering function declaration
+// Renders one image per camera, tiles of all views share a single queue and thread pool.
+// cams and imgs must have the same size, with distinct non-null images, otherwise the job is failed().
+std::unique_ptr<render_job> render_batch_async(const std::vector<pinhole_cam>& cams, const hittable_list& scene, const std::vector<image*>& imgs, const directional_light& dir_light, const render_options& opts);
+
+// batch rendering function declaration
+// Returns false if the batch was rejected
+bool render_batch(const std::vector<pinhole_cam>& cams, const hittable_list& scene, const std::vector<image*>& imgs, const directional_light& dir_light, const render_options& opts);